@@ -0,0 +1,691 @@
+// I2C EEPROM access - the transfer methods and the asynchronous job API
+
+// Copyright Tim Chilton 26/08/2014 
+
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/timerfd.h>
+#include "eeprom.h"
+
+// Internal functions
+static int    probeReady(struct eeprom * dev);
+static int    chunkSize(struct eeprom * dev, int address, int toWrite, int pageSize);
+static int    gotoAddress(struct eeprom * dev, int address);
+static int    smbusAccess(struct eeprom * dev, char rw, int command, int size, union i2c_smbus_data * data);
+static int    writeChunk(struct eeprom * dev, int address, char * bp, int len);
+static int    readChunk(struct eeprom * dev, int address, char * buf, int len);
+static void   jobArm(struct eepromJob * job, int usec);
+static void   jobEnd(struct eepromJob * job, int error);
+
+// Constants
+#define FILEIO      4096        // Transfer size for eeprom files, the kernel splits it into pages
+#define POLLINTERVAL 100        // Time between ready polls and retries of async jobs (us), about
+                                // one failed poll's worth of bus time at 100KHz
+#define POLLTIMEOUT 250         // Ready polls before an async job gives up on the device (25ms)
+
+// The transfer methods - the adapter functionality each needs and the most data
+// it can write and read in one transfer (SMBus I2C blocks are 32 bytes including
+// the low address byte)
+static const struct {
+    const char      * name;
+    unsigned long   funcs;
+    int             maxWrite;
+    int             maxRead;
+} methods[] = {
+    { "I2C_RDWR",           I2C_FUNC_I2C,   1024, 1024 },
+    { "read/write",         I2C_FUNC_I2C,   1024, 1024 },
+    { "SMBus I2C block",    I2C_FUNC_SMBUS_WRITE_I2C_BLOCK | I2C_FUNC_SMBUS_WRITE_BYTE_DATA | I2C_FUNC_SMBUS_READ_BYTE,
+                            I2C_SMBUS_BLOCK_MAX - 1, 1024 },
+    { "SMBus byte",         I2C_FUNC_SMBUS_WRITE_WORD_DATA | I2C_FUNC_SMBUS_WRITE_BYTE_DATA | I2C_FUNC_SMBUS_READ_BYTE,
+                            1, 1024 },
+    { "eeprom file",        0,              FILEIO, FILEIO },
+};
+
+// Open the connection to the device and pick the fastest transfer method the
+// adapter supports, unless one has been asked for
+// If a kernel driver owns the device, its eeprom file is used instead
+void openDevice(struct eeprom * dev, int bus, int device, int pageSize, int sizek, int method, char * path) {
+    char            filename[20];
+    char            sysfs[MAXFILEPATH];
+    unsigned long   funcs;
+    int             lp;
+
+    sprintf(sysfs,"/sys/bus/i2c/devices/%d-%04x/eeprom",bus,device);    // Where at24 puts it
+    if (strlen(path)) {                         // An explicit eeprom file
+        openFile(dev, path, sizek * 1024);
+        return;
+    } else if (method == XFER_FILE) {           // The kernel driver's file for this device
+        openFile(dev, sysfs, sizek * 1024);
+        return;
+    }
+
+    printf("Opening device 0x%02x on bus %x...\n",device,bus);
+    sprintf(filename,"/dev/i2c-%d",bus);		// Includes the I2C bus that the device is on
+    if ((dev->fh = open(filename,O_RDWR)) < 0) {
+        printf("Failed to open the bus.\n");
+        /* ERROR HANDLING; you can check errno to see what went wrong */
+        exit(20);
+    }
+
+    if (ioctl(dev->fh, I2C_SLAVE, device) < 0) {
+        if (errno == EBUSY && method == XFER_AUTO && access(sysfs, F_OK) == 0) {
+            printf("Device is bound to a kernel driver\n");
+            close(dev->fh);
+            openFile(dev, sysfs, sizek * 1024);
+            return;
+        }
+        printf("Failed to acquire bus access and/or talk to slave.\n");
+        /* ERROR HANDLING; you can check errno to see what went wrong */
+        exit(20);
+    }
+
+    if (sizek == 0) {                           // Only the bus needs the default, files know their size
+        sizek = DEFAULTSIZEK;
+    }
+    printf("Device is %dK with page size of %d bytes\n",sizek, pageSize);
+    dev->device   = device;
+    dev->size     = sizek * 1024;
+    dev->readOnly = 0;
+
+    // If the adapter won't say what it can do, plain read / write is the best bet
+    if (ioctl(dev->fh, I2C_FUNCS, &funcs) < 0) {
+        funcs = I2C_FUNC_I2C;
+        if (method == XFER_AUTO) {
+            method = XFER_RW;
+        }
+    }
+
+    if (method == XFER_AUTO) {                  // Methods are in order of preference
+        for (lp = XFER_RDWR ; lp <= XFER_SMBBYTE ; lp++) {
+            if ((funcs & methods[lp].funcs) == methods[lp].funcs) {
+                method = lp;
+                break;
+            }
+        }
+        if (method == XFER_AUTO) {
+            printf("Adapter does not support any usable transfer method\n");
+            exit(20);
+        }
+    } else if ((funcs & methods[method].funcs) != methods[method].funcs) {
+        printf("Adapter does not support %s transfers\n", methods[method].name);
+        exit(20);
+    }
+    dev->method = method;
+    dev->ioSize = pageSize;
+
+    printf("Using %s transfers\n", methods[method].name);
+    printf("\n");
+}
+
+// Open a kernel eeprom file (at24 sysfs or nvmem) or a plain file in place of the bus
+// The kernel splits our large transfers into pages and waits for each write cycle
+// If memSize is 0 the device size is taken from the file, otherwise the file must be
+// at least that big. Character devices have no size, so are taken on trust
+void openFile(struct eeprom * dev, char * path, int memSize) {
+    struct stat     st;
+
+    printf("Opening %s...\n", path);
+    dev->readOnly = 0;
+    if ((dev->fh = open(path, O_RDWR)) < 0) {
+        if ((dev->fh = open(path, O_RDONLY)) < 0) {     // Reading needs less privilege
+            printf("Failed to open the eeprom file.\n");
+            exit(20);
+        }
+        dev->readOnly = 1;
+        printf("Opened read only\n");
+    }
+
+    if (fstat(dev->fh, &st) < 0) {
+        printf("Failed to get the size of the eeprom file.\n");
+        exit(20);
+    }
+    if (S_ISREG(st.st_mode)) {
+        if (memSize == 0) {                     // Use the whole file, up to the largest device
+            memSize = (st.st_size < MAXSIZEK * 1024) ? st.st_size : MAXSIZEK * 1024;
+            if (memSize == 0) {
+                printf("The eeprom file is empty\n");
+                exit(20);
+            }
+        } else if (st.st_size < memSize) {
+            printf("The eeprom file is %ld bytes, smaller than the device size of %d bytes\n",
+                (long) st.st_size, memSize);
+            exit(20);
+        }
+    } else if (memSize == 0) {
+        memSize = DEFAULTSIZEK * 1024;
+    }
+
+    dev->device = 0;
+    dev->method = XFER_FILE;
+    dev->size   = memSize;
+    dev->ioSize = (memSize < FILEIO) ? memSize : FILEIO;
+
+    printf("Device is %d bytes\n", memSize);
+    printf("Using %s transfers\n", methods[XFER_FILE].name);
+    printf("\n");
+}
+
+// Perform a single SMBus transaction with the device
+static int smbusAccess(struct eeprom * dev, char rw, int command, int size, union i2c_smbus_data * data) {
+    struct i2c_smbus_ioctl_data     args;
+
+    args.read_write = rw;
+    args.command    = command;
+    args.size       = size;
+    args.data       = data;
+    return (ioctl(dev->fh, I2C_SMBUS, &args) < 0);
+}
+
+// Go to the specified address in the chip
+// The caller makes sure that the chip is ready first
+static int gotoAddress(struct eeprom * dev, int address) {
+	char			buf[5];
+	int				ret;
+    union i2c_smbus_data    data;
+
+#ifdef DEBUGGING
+    const char *	buffer;
+#endif
+
+    buf[0] = (address & 0xFF00) >> 8;
+    buf[1] = address & 0xFF;
+
+    if (dev->method == XFER_FILE) {         // pread / pwrite carry their own address
+        ret = 2;
+    } else if (dev->method == XFER_SMBBLOCK || dev->method == XFER_SMBBYTE) {
+        data.byte = buf[1];                 // Address high byte as the command, then the low byte
+        ret = smbusAccess(dev, I2C_SMBUS_WRITE, buf[0] & 0xFF, I2C_SMBUS_BYTE_DATA, &data) ? -1 : 2;
+    } else {
+        ret = write(dev->fh, buf, 2);
+    }
+    if (ret != 2) {                         // ERROR HANDLING: i2c transaction failed 
+        #ifdef DEBUGGING
+            printf("Failed to set the EEPROM address.\n");
+            buffer = strerror(errno);
+            printf(buffer);
+            printf("\n\n");
+        #endif
+		return (1);
+    }
+	return (0);
+}
+
+
+// Write one transfer's worth of data at the specified address, the caller ensures
+// that it fits within the method's limit and does not cross a page boundary
+// bp has two spare bytes in front of the data for the address
+static int writeChunk(struct eeprom * dev, int address, char * bp, int len) {
+    struct i2c_msg              msg;
+    struct i2c_rdwr_ioctl_data  rdwr;
+    union i2c_smbus_data        data;
+
+    bp[0] = (address & 0xFF00) >> 8;            // Move to the specified address
+    bp[1] = address & 0xFF;
+
+    switch (dev->method) {
+        case XFER_RDWR:                         // Address and data in one message
+            msg.addr  = dev->device;
+            msg.flags = 0;
+            msg.len   = len + 2;
+            msg.buf   = (unsigned char *) bp;
+            rdwr.msgs  = &msg;
+            rdwr.nmsgs = 1;
+            return (ioctl(dev->fh, I2C_RDWR, &rdwr) != 1);
+
+        case XFER_SMBBLOCK:                     // Address high byte is the command
+            data.block[0] = len + 1;            // then the block is the low byte and the data
+            memcpy(&data.block[1], bp + 1, len + 1);
+            return (smbusAccess(dev, I2C_SMBUS_WRITE, bp[0] & 0xFF, I2C_SMBUS_I2C_BLOCK_DATA, &data));
+
+        case XFER_SMBBYTE:                      // A word write sends command, low, high
+            data.word = (bp[1] & 0xFF) | ((bp[2] & 0xFF) << 8);   // so carries both the low address and the data
+            return (smbusAccess(dev, I2C_SMBUS_WRITE, bp[0] & 0xFF, I2C_SMBUS_WORD_DATA, &data));
+
+        case XFER_FILE:                         // The kernel does the paging and write cycle waits
+            return (pwrite(dev->fh, bp + 2, len, address) != len);
+
+        default:                                // Plain write
+            return (write(dev->fh, bp, len + 2) != len + 2);
+    }
+}
+
+
+// Read one transfer's worth of data from the specified address
+static int readChunk(struct eeprom * dev, int address, char * buf, int len) {
+    struct i2c_msg              msg[2];
+    struct i2c_rdwr_ioctl_data  rdwr;
+    union i2c_smbus_data        data;
+    unsigned char               abuf[2];
+    int                         lp;
+
+    switch (dev->method) {
+        case XFER_RDWR:                         // Set the address and read back with a repeated start
+            abuf[0] = (address & 0xFF00) >> 8;  // so no other master can move the address in between
+            abuf[1] = address & 0xFF;
+            msg[0].addr  = dev->device;
+            msg[0].flags = 0;
+            msg[0].len   = 2;
+            msg[0].buf   = abuf;
+            msg[1].addr  = dev->device;
+            msg[1].flags = I2C_M_RD;
+            msg[1].len   = len;
+            msg[1].buf   = (unsigned char *) buf;
+            rdwr.msgs  = msg;
+            rdwr.nmsgs = 2;
+            return (ioctl(dev->fh, I2C_RDWR, &rdwr) != 2);
+
+        case XFER_SMBBLOCK:                     // An I2C block read only sends one address byte, which
+        case XFER_SMBBYTE:                      // a 16 bit addressed part can't use, so set the address
+            if (gotoAddress(dev, address)) {    // then do sequential current address reads
+                return (1);
+            }
+            for (lp = 0 ; lp < len ; lp++) {
+                if (smbusAccess(dev, I2C_SMBUS_READ, 0, I2C_SMBUS_BYTE, &data)) {
+                    return (1);
+                }
+                *buf++ = data.byte;
+            }
+            return (0);
+
+        case XFER_FILE:
+            return (pread(dev->fh, buf, len, address) != len);
+
+        default:                                // Plain write of the address, then read
+            if (gotoAddress(dev, address)) {
+                return (1);
+            }
+            return (read(dev->fh, buf, len) != len);
+    }
+}
+
+
+// Write the specified buffer at the specified offset
+// Ensure that we do not exceed the maximum page size of the device, or the largest
+// transfer the method can do
+// Since the I2C bus is a shared resource, we may fail to read if another device is 
+// doing someething (including talking to our chip !)
+int writeTo(struct eeprom * dev, int address, char * buf, int pageSize) {
+    char            * bp;
+	int		        toWrite = pageSize;
+    int             thisWrite;
+    int             retries=0;
+    int             success=0;
+
+#ifdef DEBUGGING
+    const char *	buffer;
+#endif
+
+	if (!(bp= (char *) malloc(pageSize+3))) {       // Biggest thing we can write is a page - plus an address
+		printf("Malloc failed !");
+		exit(2);
+	}
+
+//    printf("Write at address 0x%04x for 0x%04x bytes\n",address, iolen);
+
+	while (toWrite >0) {                        // Still data to write
+        pollReady(dev);                         // Wait until the chip is ready to do another operation
+        thisWrite = chunkSize(dev, address, toWrite, pageSize);
+        memcpy(bp + 2, buf, thisWrite);         // Leave room for the address
+        success=0;
+        retries=0;
+        while (!success && retries < 100) {
+            if (writeChunk(dev, address, bp, thisWrite)) {      // Try to write the data
+                #ifdef DEBUGGING
+                    printf("Failed to write to i2c bus.\n");    
+                    buffer = strerror(errno);
+                    printf(buffer);
+                    printf("\n\n");
+                #else
+                    putchar('E');               // Indicate error on output
+                    fflush(stdout);
+                #endif
+                usleep(10);	                    // 10us delay
+                retries++;
+
+            } else {
+                success=1;
+            }
+        }
+
+        if (!success) {
+            printf("\nHard write error - aborting\n");
+            exit (21);
+        }
+
+        buf += thisWrite;
+        toWrite -= thisWrite;
+        address += thisWrite;       // Update the address of the next write
+	}
+    pollReady(dev);             // Wait until the chip is ready to do another operation
+	free (bp);
+    return (success);
+}
+
+// Read from the specified device into the provided buffer
+// It seems that the I2C driver subsystem or devices can't handle read beyond 1K,
+// so use smaller reads ..
+// Since the I2C bus is a shared resource, we may fail to read if another device is 
+// doing someething (including talking to our chip !)
+
+int	readFrom(struct eeprom * dev, int address, char * buf, int iolen) {
+    int             retries=0;
+    int             success=0;
+
+#ifdef DEBUGGING
+    const char *	buffer;
+#endif
+
+    if (iolen > methods[dev->method].maxRead) {
+        printf("Maximum IO length is %d. use a smaller read\n", methods[dev->method].maxRead);
+        return (-1);
+    }
+
+    while (!success && retries++ <100) {
+        pollReady(dev);                                             // Wait until the chip is ready to do another operation
+        if (readChunk(dev, address, buf, iolen)) {                  // I2C Read
+            #ifdef DEBUGGING
+                printf("Failed to read 0x%04x from the i2c bus.\n",address);   // ERROR HANDLING: i2c transaction failed 
+                buffer = strerror(errno);
+                printf(buffer);
+                printf("\n\n");
+            #else
+                putchar('E');                                       // Indicate error on output
+                fflush(stdout);
+            #endif
+            usleep(10);	                                            // 10us delay
+        } else {
+            success=1;
+        }
+    }     
+    if (!success) {
+        printf("\nHard read error - aborting\n");
+        exit (22);
+    }
+    return (0);
+}
+
+// Poll for the device being ready. This is done by performing a single byte read
+// the device will fail to acknowledge whilst it is still busy writing
+
+int pollReady(struct eeprom * dev) {
+    int             timeout=100;
+
+    // Poll for the device coming ready after a write - reads cant be performed whilst a write is occurring
+    while (probeReady(dev)) {
+        usleep(1);	                                        // 1us delay
+        if (timeout-- == 0) {
+            return (1);                                     // If its taken this long then the chip is dead
+        }
+    }
+    return (0);
+}
+
+// Make a single attempt to see if the device is ready, returns 0 if it is
+static int probeReady(struct eeprom * dev) {
+	char            buf[2];
+    struct i2c_msg              msg;
+    struct i2c_rdwr_ioctl_data  rdwr;
+    union i2c_smbus_data        data;
+
+    switch (dev->method) {
+        case XFER_RDWR:
+            msg.addr  = dev->device;
+            msg.flags = I2C_M_RD;
+            msg.len   = 1;
+            msg.buf   = (unsigned char *) buf;
+            rdwr.msgs  = &msg;
+            rdwr.nmsgs = 1;
+            return (ioctl(dev->fh, I2C_RDWR, &rdwr) != 1);
+
+        case XFER_FILE:                             // The kernel waits for us
+            return (0);
+
+        case XFER_SMBBLOCK:
+        case XFER_SMBBYTE:
+            return (smbusAccess(dev, I2C_SMBUS_READ, 0, I2C_SMBUS_BYTE, &data));
+
+        default:
+            return (read(dev->fh,buf,1) != 1);
+    }
+}
+
+// Largest write at the address that stays within its page and the method's limit
+static int chunkSize(struct eeprom * dev, int address, int toWrite, int pageSize) {
+    int             len;
+
+    len = pageSize - (address % pageSize);          // Up to the end of this page
+    if (len > methods[dev->method].maxWrite) {
+        len = methods[dev->method].maxWrite;
+    }
+    if (len > toWrite) {
+        len = toWrite;
+    }
+    return (len);
+}
+
+
+// ******************
+// Asynchronous jobs
+// ******************
+
+// A job reads or writes a block of the device a page at a time without blocking
+// between pages, for callers with their own event loop. Poll jobFd() for input,
+// then call jobStep() each time it is readable. The write cycle waits are timed by
+// a timerfd rather than busy polling the device. When the job finishes its fd is
+// closed and then the completion callback is called, so the callback may free the
+// job or start another on it. jobCancel() drops a job that is still running.
+
+// Start a read (writing = 0) or write (writing = 1) of len bytes at address
+// Each step moves at most pageSize bytes, which for reads must be within the method's limit
+// Returns 0 if the job was started, -1 if the arguments are invalid or it could not be set up
+int jobStart(struct eepromJob * job, struct eeprom * dev, int writing, int address, char * buf, int len,
+             int pageSize, void (*complete)(struct eepromJob * job), void * arg) {
+    memset(job, 0, sizeof(*job));
+    job->state    = JOB_DONE;                   // Until it has started, so jobStep does nothing
+    job->fd       = -1;
+    job->dev      = dev;
+    job->write    = writing;
+    job->address  = address;
+    job->buf      = buf;
+    job->length   = len;
+    job->pageSize = pageSize;
+    job->complete = complete;
+    job->arg      = arg;
+
+    if (len <= 0 || pageSize <= 0 || address < 0 || address + len > dev->size) {
+        return (-1);
+    }
+    if (!writing && pageSize > methods[dev->method].maxRead) {
+        return (-1);
+    }
+
+    if (!(job->page = (char *) malloc(pageSize+3))) {     // A page plus an address
+        return (-1);
+    }
+    if ((job->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0) {
+        free(job->page);
+        job->page = NULL;
+        return (-1);
+    }
+    job->state = writing ? JOB_WAIT : JOB_READ; // Writes start by checking the device is ready
+    jobArm(job, 0);
+    return (0);
+}
+
+// The file descriptor to poll, it becomes readable when the job can take another step
+int jobFd(struct eepromJob * job) {
+    return (job->fd);
+}
+
+// Take the next step of the job, at most one page is transferred
+// Returns 1 whilst the job is running, 0 once it has finished (job->error is 0
+// on success, or the exit code that the same failure gives the command line)
+// The job is not touched after its callback, so if the callback started another
+// job on it, poll the new jobFd() rather than relying on the return value
+int jobStep(struct eepromJob * job) {
+    uint64_t        expired;
+    int             len;
+
+    if (job->state == JOB_DONE) {
+        return (0);
+    }
+    if (read(job->fd, &expired, sizeof(expired)) != sizeof(expired)) {
+        return (1);                             // Not due yet
+    }
+
+    switch (job->state) {
+        case JOB_WAIT:                          // Waiting for the last write to complete
+            if (probeReady(job->dev)) {
+                if (++job->polls >= POLLTIMEOUT) {
+                    jobEnd(job, 21);            // If its taken this long then the chip is dead
+                    return (0);
+                }
+                jobArm(job, POLLINTERVAL);
+                return (1);
+            }
+            if (job->done == job->length) {
+                jobEnd(job, 0);
+                return (0);
+            }
+            job->state = JOB_WRITE;
+            /* Fall through - ready for the next page */
+
+        case JOB_WRITE:
+            len = chunkSize(job->dev, job->address + job->done, job->length - job->done, job->pageSize);
+            memcpy(job->page + 2, job->buf + job->done, len);   // Leave room for the address
+            if (writeChunk(job->dev, job->address + job->done, job->page, len)) {
+                job->errors++;
+                if (++job->retries >= 100) {
+                    jobEnd(job, 21);
+                    return (0);
+                }
+                jobArm(job, POLLINTERVAL);
+                return (1);
+            }
+            job->done   += len;
+            job->retries = 0;
+            job->polls   = 0;
+            job->state   = JOB_WAIT;
+            jobArm(job, (job->dev->method == XFER_FILE) ? 0 : POLLINTERVAL);  // Ready as soon as the part acks
+            return (1);
+
+        case JOB_READ:
+            // A single ready probe at the start and after a failure, the device
+            // can't have become busy between our own reads
+            if ((job->done == 0 || job->retries) && probeReady(job->dev)) {
+                if (++job->polls >= POLLTIMEOUT) {
+                    jobEnd(job, 22);
+                    return (0);
+                }
+                jobArm(job, POLLINTERVAL);
+                return (1);
+            }
+            job->polls = 0;
+            len = job->length - job->done;
+            if (len > job->pageSize) {
+                len = job->pageSize;
+            }
+            if (readChunk(job->dev, job->address + job->done, job->buf + job->done, len)) {
+                job->errors++;
+                if (++job->retries >= 100) {
+                    jobEnd(job, 22);
+                    return (0);
+                }
+                jobArm(job, POLLINTERVAL);
+                return (1);
+            }
+            job->done   += len;
+            job->retries = 0;
+            if (job->done == job->length) {
+                jobEnd(job, 0);
+                return (0);
+            }
+            jobArm(job, 0);
+            return (1);
+    }
+    return (0);
+}
+
+// Set the job's timer to fire after the given number of microseconds
+// A zero time would disarm the timer, so make it fire straight away
+static void jobArm(struct eepromJob * job, int usec) {
+    struct itimerspec   its;
+
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec  = usec / 1000000;
+    its.it_value.tv_nsec = (usec % 1000000) * 1000 + 1;
+    timerfd_settime(job->fd, 0, &its, NULL);
+}
+
+// Finish the job, release its resources and tell the caller
+// The callback is the last thing done, as it may reuse or free the job
+static void jobEnd(struct eepromJob * job, int error) {
+    void    (*complete)(struct eepromJob * job) = job->complete;
+
+    jobCancel(job);
+    job->error = error;
+    if (complete) {
+        complete(job);
+    }
+}
+
+// Stop a job and release its resources, without calling the completion callback
+void jobCancel(struct eepromJob * job) {
+    if (job->state == JOB_DONE) {
+        return;
+    }
+    close(job->fd);
+    job->fd = -1;
+    free(job->page);
+    job->page = NULL;
+    job->state = JOB_DONE;
+}
+
+// Drive a job to completion, for callers without an event loop of their own
+// Shows a . for each page and an E for each transient error, like the blocking calls
+int runJob(struct eepromJob * job) {
+    struct pollfd   pfd;
+    int             running = 1;
+    int             shown = 0;
+    int             errors = 0;
+
+    while (running) {
+        pfd.fd     = jobFd(job);
+        pfd.events = POLLIN;
+        poll(&pfd, 1, -1);
+        running = jobStep(job);
+
+        for ( ; errors < job->errors ; errors++) {
+            putchar('E');                       // Indicate error on output
+        }
+        for ( ; shown + job->pageSize <= job->done ; shown += job->pageSize) {
+            putchar('.');
+        }
+        fflush(stdout);
+    }
+    return (job->error);
+}
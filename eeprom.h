@@ -0,0 +1,87 @@
+// I2C EEPROM access - the transfer methods and the asynchronous job API
+
+// Copyright Tim Chilton 26/08/2014 
+
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+// The blocking calls (openDevice, readFrom, writeTo) report progress on stdout and
+// exit with the command line's exit codes on a hard error. The job calls (jobStart,
+// jobFd, jobStep, jobCancel) never print or exit, errors are returned in the job for
+// event driven callers. runJob drives a job to completion for the command line.
+
+#ifndef EEPROM_H
+#define EEPROM_H
+
+#define MAXFILEPATH 250         // Maximum file name length
+#define DEFAULTSIZEK 4          // Device size in Kb if -s is not given (and not known from a file)
+#define MAXSIZEK    64          // Largest device size in Kb
+
+// Ways of transferring data with the device, in order of preference
+#define XFER_AUTO       -1      // Pick the best that the adapter supports
+#define XFER_RDWR       0       // I2C_RDWR combined transfers
+#define XFER_RW         1       // Plain read / write
+#define XFER_SMBBLOCK   2       // SMBus I2C block writes, byte reads
+#define XFER_SMBBYTE    3       // SMBus a byte at a time
+#define XFER_FILE       4       // pread / pwrite on a kernel eeprom file (or any file)
+
+// An open EEPROM and how we talk to it
+struct eeprom {
+    int     fh;                 // File handle of the I2C bus or eeprom file
+    int     device;             // I2C address of the device
+    int     method;             // Transfer method, one of the XFER_ values
+    int     ioSize;             // Bytes moved per transfer when reading or writing the whole device
+    int     size;               // Size of the device in bytes
+    int     readOnly;           // True if the eeprom file could only be opened for reading
+};
+
+// Asynchronous job states
+#define JOB_WRITE       0       // Next step writes a page
+#define JOB_WAIT        1       // Waiting for the write cycle to finish
+#define JOB_READ        2       // Next step reads a page
+#define JOB_DONE        3       // Finished, error holds the result
+
+// A read or write of the device that is stepped a page at a time from an event loop
+struct eepromJob {
+    struct eeprom * dev;
+    int     write;              // True for a write
+    int     address;            // Device address of the start of the block
+    char    * buf;              // Data to write, or where to read to
+    int     length;             // Size of the block
+    int     pageSize;           // Most data moved in one step
+    int     done;               // Bytes transferred so far
+    int     state;              // One of the JOB_ values
+    int     fd;                 // timerfd that fires when the next step is due
+    char    * page;             // Page buffer, with room for the address
+    int     retries;            // Failures of the current transfer
+    int     polls;              // Ready polls since the last write
+    int     errors;             // Transient errors over the whole job
+    int     error;              // Result, 0 or the command line exit code for the failure
+    void    (*complete)(struct eepromJob * job);    // Called when the job finishes
+    void    * arg;              // For the caller's use
+};
+
+// Function prototypes
+void    openDevice(struct eeprom * dev, int bus, int device, int pageSize, int sizek, int method, char * path);
+void    openFile(struct eeprom * dev, char * path, int memSize);
+int     writeTo(struct eeprom * dev, int address, char * buf, int pageSize);
+int     readFrom(struct eeprom * dev, int address, char * buf, int iolen);
+int     pollReady(struct eeprom * dev);
+int     jobStart(struct eepromJob * job, struct eeprom * dev, int writing, int address, char * buf, int len,
+                 int pageSize, void (*complete)(struct eepromJob * job), void * arg);
+int     jobFd(struct eepromJob * job);
+int     jobStep(struct eepromJob * job);
+void    jobCancel(struct eepromJob * job);
+int     runJob(struct eepromJob * job);
+
+#endif
@@ -17,6 +17,10 @@
 
 // Version 0.1 29/08/2014 Initial release
 // Version 0.2 30/08/2014 Improved patterns, removed global variables, added write enable flag
+// Version 0.3 19/10/2026 Walking, address and random patterns, March C- and planned self test
+//                        Transfer method chosen from the adapter's capabilities
+//                        Kernel at24 / nvmem eeprom file support
+//                        Non blocking jobs for event driven callers, used for device writes
 
 // Note that on a shared I2C bus, other controllers may be addressing the 
 // same device, so always reset the address pointers before any data 
@@ -30,32 +34,79 @@
 #include <stdint.h>
 #include <ctype.h>
 #include <unistd.h>
-#include <linux/i2c-dev.h>
-#include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include "eeprom.h"
 
 // Function prototypes
-int     pollReady(int fh);
-int     writeTo(int fh, int address, char * buf, int pageSize);
-int     readFrom(int fh, int address, char * buf, int iolen);
-int     gotoAddress(int fh, int address);
 void    usage(void);
 int     checkValid(int size);
 int     myatoi(const char *str);
 int     hexDump(char * membuf, int size);
-void    readDevice(int fh, char * membuf, int memSize, int pageSize);
-void    writeDevice(int fh, char * membuf, int memSize, int pageSize);
-int     verifyToBuffer(int fh, char * membuf, int memSize, int pageSize);
+void    readDevice(struct eeprom * dev, char * membuf, int memSize);
+void    writeDevice(struct eeprom * dev, char * membuf, int memSize);
+int     verifyToBuffer(struct eeprom * dev, char * membuf, int memSize);
 void    readFileToBuffer(char * membuf, char * filename, int memSize);
 void    writeFileFromBuffer(char * membuf, char * filename, int memSize);
-int     openDevice(int bus, int device, int pageSize, int sizek); 
-void    fillBuffer(char * membuf, int pattern,int memSize, int pageSize);
+void    fillBuffer(char * membuf, int pattern,int memSize, int pageSize, unsigned int seed);
+void    replicate(char * membuf, int period, int memSize);
+int     compareDevice(struct eeprom * dev, char * membuf, int memSize);
+int     marchTest(struct eeprom * dev, char * membuf, int memSize, int pageSize);
+int     planTest(int faults);
+int     testDevice(struct eeprom * dev, char * membuf, int memSize, int pageSize, int level, unsigned int seed);
 
 // Constants
-#define MAXFILEPATH 250         // Maximum file name length
+#define MAXERRORS   10          // Number of verify errors reported before going quiet
+#define MAXLEVEL    5           // Highest self test coverage level
+
+// Generated fill patterns, constant fills and the checkerboards use the byte value itself
+#define PAT_INCREMENT   -1      // Incremental +3
+#define PAT_WALK1       -2      // Walking one's
+#define PAT_WALK0       -3      // Walking zero's
+#define PAT_ADDRESS     -4      // Address in address
+#define PAT_RANDOM      -5      // Seeded pseudo random
+#define PAT_MARCH       -6      // March C- (self test only, not a fill)
+#define PAT_NONE        -99     // Unused slot in the test table
+
+// Fault classes that the self test can be asked to cover
+#define FAULT_SA0   0x01        // Cell stuck at zero
+#define FAULT_SA1   0x02        // Cell stuck at one
+#define FAULT_AF    0x04        // Address decoder fault - aliased or missing locations
+#define FAULT_DF    0x08        // Data line fault - shorted or open bits within a byte
+#define FAULT_TF    0x10        // Transition fault - cell will not change state one way
+#define FAULT_CF    0x20        // Coupling fault - writing one location disturbs another
+#define FAULT_PSF   0x40        // Pattern sensitive fault
+
+// The tests that the planner can choose from, each one costs a number of full device
+// passes over the bus (a write pass plus a verify pass per pattern, the March test
+// is one write, four read+write and one read pass)
+struct testDef {
+    const char  * name;
+    int         patterns[2];        // Fill patterns run by this test
+    int         passes;             // Full device bus passes
+    int         covers;             // Fault classes detected
+};
+
+static const struct testDef tests[] = {
+    { "Checkerboard",           { 0x55,         0xaa        },  4, FAULT_SA0 | FAULT_SA1 },
+    { "Address in address",     { PAT_ADDRESS,  PAT_NONE    },  2, FAULT_AF },
+    { "Walking one's / zero's", { PAT_WALK1,    PAT_WALK0   },  4, FAULT_DF },
+    { "March C-",               { PAT_MARCH,    PAT_NONE    }, 10, FAULT_SA0 | FAULT_SA1 | FAULT_AF | FAULT_TF | FAULT_CF },
+    { "Pseudo random",          { PAT_RANDOM,   PAT_NONE    },  2, FAULT_PSF },
+};
+#define NUMTESTS    (sizeof(tests) / sizeof(tests[0]))
+
+// Fault classes required by each self test level, each level includes the one below
+static const int levelFaults[MAXLEVEL+1] = {
+    0,
+    FAULT_SA0 | FAULT_SA1,                                          // 1 - Stuck cells
+    FAULT_SA0 | FAULT_SA1 | FAULT_AF,                               // 2 - + Address decoder
+    FAULT_SA0 | FAULT_SA1 | FAULT_AF | FAULT_DF,                    // 3 - + Data lines
+    FAULT_SA0 | FAULT_SA1 | FAULT_AF | FAULT_DF | FAULT_TF | FAULT_CF, // 4 - + Transition / coupling
+    FAULT_SA0 | FAULT_SA1 | FAULT_AF | FAULT_DF | FAULT_TF | FAULT_CF | FAULT_PSF, // 5 - + Pattern sensitive
+};
 
 // Compile with this in for more verbose output
 //#define DEBUGGING 1
@@ -66,22 +117,24 @@ int main(int argc, char * argv[]) {
     int     busaddr     = 1;        // I2C bus address
     int     i2caddr     = 0x51;		// The I2C address of the device - EEPROM
     int	    pageSize    = 32;       // Number of bytes max for a page write
-    int     sizek       = 4;        // Default device size in Kb
+    int     sizek       = 0;        // Device size in Kb, 0 for the default or the eeprom file's size
     int	    memSize;              	// Size of the device in bytes
     int     check;  
     int     i;
-    int     fhand;					// Filename of the I2C device
+    struct eeprom dev;              // The open I2C device
+    int     method = XFER_AUTO;     // Transfer method, or pick the best
+    char    eepromfile[MAXFILEPATH] = { '\0' };  // Kernel eeprom file to use instead of the bus
     int     doFill      = 0;        // True if we are filling memory
     int     doRead      = 0;        // True if we are reading the device
     int     doWrite     = 0;        // True if we are writing the memory 
     int     doHexDump   = 0;        // True if we are hexdumping the memory to stdout
     int     doVerify    = 0;        // True if we are verifying a read/write operation
     int     writeEnable = 0;        // True if the -y flag has been set to enable writes
-    int     pattern;                // The fill pattern
+    int     doTest      = 0;        // Self test coverage level, 0 for no test
+    int     pattern     = 0;        // The fill pattern
+    unsigned int seed   = 1;        // Seed for the pseudo random pattern
     char    * membuf;               // Memory buffer 
 
-    memSize = sizek * 1024;
-
     // Handle the arguments
 	if (argc < 3) {
 		usage();
@@ -107,9 +160,8 @@ int main(int argc, char * argv[]) {
 				case 's':              // Set the device size in Kb
                     if (++i >= argc) { usage(); }
                     check = myatoi(argv[i]);
-                    if (checkValid(check) && check <=64) {
+                    if (checkValid(check) && check <=MAXSIZEK) {
                         sizek = check;
-                        memSize = sizek * 1024;
                     } else {
                         printf("Device size must be a binary multiple in the 1-64K range\n");
                         exit(1);
@@ -152,6 +204,26 @@ int main(int argc, char * argv[]) {
                             doFill=1;
                             break;
 
+                        case 'w':               // Walking one's
+                            pattern=PAT_WALK1;
+                            doFill=1;
+                            break;
+
+                        case 'z':               // Walking zero's
+                            pattern=PAT_WALK0;
+                            doFill=1;
+                            break;
+
+                        case 'a':               // Address in address
+                            pattern=PAT_ADDRESS;
+                            doFill=1;
+                            break;
+
+                        case 'r':               // Pseudo random
+                            pattern=PAT_RANDOM;
+                            doFill=1;
+                            break;
+
                         default:
                             printf("Invalid Fill pattern\n");
                             usage();
@@ -160,6 +232,49 @@ int main(int argc, char * argv[]) {
                     doFill = 1;
 					break;
 
+				case 't':              // Self test to the given coverage level
+                    if (++i >= argc) { usage(); }
+                    check = myatoi(argv[i]);
+                    if (check >= 1 && check <= MAXLEVEL) {
+                        doTest = check;
+                    } else {
+                        printf("Test level must be in the 1-%d range\n", MAXLEVEL);
+                        exit(1);
+                    }
+					break;
+
+				case 'm':              // Force the transfer method
+                    if (++i >= argc) { usage(); }
+                    switch (argv[i][0]){
+                        case 'a':   method=XFER_AUTO;       break;
+                        case 'i':   method=XFER_RDWR;       break;
+                        case 'r':   method=XFER_RW;         break;
+                        case 'b':   method=XFER_SMBBLOCK;   break;
+                        case 's':   method=XFER_SMBBYTE;    break;
+                        case 'k':   method=XFER_FILE;       break;
+
+                        default:
+                            printf("Invalid transfer method\n");
+                            usage();
+                    }
+					break;
+
+				case 'k':              // Kernel eeprom file to use
+                    if (++i >= argc) { usage(); }
+                    if (strlen(argv[i]) < MAXFILEPATH) {
+                        strcpy(eepromfile,argv[i]);
+                        method = XFER_FILE;
+                    } else {
+                        printf("Filename is too long..\n");
+                        exit(1);
+                    }
+					break;
+
+				case 'e':              // Seed for the pseudo random pattern
+                    if (++i >= argc) { usage(); }
+                    seed = (unsigned int) myatoi(argv[i]);
+					break;
+
 				case 'd':              // Hexdump the devices contents
                     doHexDump=1;
 					break;
@@ -206,19 +321,25 @@ int main(int argc, char * argv[]) {
 
     // Check that all the related arguments were provided 
 
-    if (!(doRead || doWrite || doVerify || doFill || doHexDump)) {
+    if (!(doRead || doWrite || doVerify || doFill || doHexDump || doTest)) {
         printf("Nothing to do - check your options !\n");
         exit(1);
     }
     
     // Check we are write enabled for any write operation
-    if ((doWrite || doFill) && !writeEnable) {
+    if ((doWrite || doFill || doTest) && !writeEnable) {
         printf("Write operation selected, but writes are not enabled\n");
         printf("You must specify -y to enable writes\n");
         exit(1);
     }
 
-    if (doFill) {       // Fill can do a verify without a filename
+    // The self test does its own verification and leaves the device in an unknown state
+    if (doTest && (doWrite || doFill || doVerify)) {
+        printf("Test can not be combined with fill, write or verify\n");
+        exit(1);
+    }
+
+    if (doFill || (doTest && !doRead)) {   // Fill and test can verify without a filename
     } else if ((doRead || doWrite || doVerify) && (strlen(filename) == 0)) {
         printf("Filename not specified\n");
         exit(1);
@@ -226,38 +347,50 @@ int main(int argc, char * argv[]) {
 
 
     // Do the work
-    fhand = openDevice(busaddr,i2caddr,pageSize, sizek); // Open the device
+    openDevice(&dev, busaddr, i2caddr, pageSize, sizek, method, eepromfile); // Open the device
+    memSize = dev.size;
+
+    if ((doWrite || doFill || doTest) && dev.readOnly) {
+        printf("Write operation selected, but the eeprom file is read only\n");
+        exit(20);
+    }
 
-	if (!(membuf= (char *) malloc(memSize+pageSize))) {  // Create the memory buffer
+	if (!(membuf= (char *) malloc(memSize+2*pageSize))) {  // Create the memory buffer, the checkerboard is built two pages at a time
 		printf("Malloc failed !");
 		exit(1);
 	}
 
     if (doFill) {                           // Fill the device with a pattern
-        fillBuffer(membuf,pattern, memSize, pageSize);
-        writeDevice(fhand, membuf, memSize, pageSize);
+        fillBuffer(membuf,pattern, memSize, pageSize, seed);
+        writeDevice(&dev, membuf, memSize);
     }
 
     if (doWrite) {                          // Write the file to the EEPROM
         readFileToBuffer(membuf,filename, memSize);
-        writeDevice(fhand, membuf, memSize, pageSize);
+        writeDevice(&dev, membuf, memSize);
     }
 
     if (doRead) {                           // Read the EEPROM to the file
-        readDevice(fhand,membuf,memSize, pageSize);
+        readDevice(&dev, membuf, memSize);
         writeFileFromBuffer(membuf, filename, memSize);
     }
 
+    if (doTest) {                           // Run the planned self test, after any backup read
+        if (testDevice(&dev, membuf, memSize, pageSize, doTest, seed)) {
+            exit(23);
+        }
+    }
+
     if (doVerify) {                         // Verify the EEPROM to the memory buffer
         if (!doFill && (!(doRead || doWrite) && doVerify)) {// Fill memory buffer if necessary
             readFileToBuffer(membuf, filename, memSize);
         }
-        verifyToBuffer(fhand, membuf, memSize, pageSize);
+        verifyToBuffer(&dev, membuf, memSize);
     }
 
     if (doHexDump) {                        // Hexdump the device out 
         printf("EEPROM contents\n\n");
-        readDevice(fhand, membuf, memSize, pageSize);
+        readDevice(&dev, membuf, memSize);
         hexDump(membuf, memSize);          
     }
 
@@ -272,7 +405,8 @@ int main(int argc, char * argv[]) {
 
 
 // Fill the device with the standard patterns
-void fillBuffer(char * membuf, int pattern, int memSize, int pageSize) {
+// Anything periodic is generated once and then replicated with block copies
+void fillBuffer(char * membuf, int pattern, int memSize, int pageSize, unsigned int seed) {
     int     chunk;
     int     lp;
     char    * bptr;
@@ -282,32 +416,221 @@ void fillBuffer(char * membuf, int pattern, int memSize, int pageSize) {
     printf("Preparing pattern ");
     // The incremental pattern fills with an increasing value but offsets by +3 on 
     // each 0x0100, this makes it possible to detect dead pages in a device
-    if (pattern == -1) {                        // Incremental pattern
+    if (pattern == PAT_INCREMENT) {             // Incremental pattern
         printf("(Increment)\n");
-        for (chunk = 0 ; chunk < (memSize / 256) ; chunk++) {
-            for(lp = 0 ; lp < 256 ; lp++) {		   
-                *bptr++ = lp + (chunk * 3);     // Add 3 on each page       
-            }
+        for (lp = 0 ; lp < memSize ; lp++) {
+            *bptr++ = (lp & 0xFF) + ((lp >> 8) * 3);    // Add 3 on each page
         }
     // These patterns write a checkerboard (chess board) across the devices array
     // It assumes that the device's internal geometry is based around the page size
 	} else if (pattern == 0x55 || pattern == 0xaa) {    // Checkerboard / inverse 
         if (pattern == 0x55) {  printf("(Checkerboard)\n");         }
         else {                  printf("(Inverse checkerboard)\n"); }
-        for (chunk = 0 ; chunk < (memSize / pageSize) ; chunk++) {
+        for (chunk = 0 ; chunk < 2 ; chunk++) { // A page and its inverse, then repeat
             for(lp = 0 ; lp < pageSize; lp++) {		   
                 *bptr++ = pattern; 
                 pattern = ~pattern;             // Invert the pattern across each cell
             }
             pattern = ~pattern;                 // Invert the pattern on each page boundary
         }
+        replicate(membuf, 2 * pageSize, memSize);
+    // A single bit set (or clear) in each byte, moving up one place per byte, 
+    // to find shorted or open data lines
+    } else if (pattern == PAT_WALK1 || pattern == PAT_WALK0) {
+        if (pattern == PAT_WALK1) { printf("(Walking one's)\n");  }
+        else {                      printf("(Walking zero's)\n"); }
+        for (lp = 0 ; lp < 8 ; lp++) {
+            *bptr++ = (pattern == PAT_WALK1) ? (1 << lp) : ~(1 << lp);
+        }
+        replicate(membuf, 8, memSize);
+    // Each byte holds its low address byte xor'd with its high address byte, so any
+    // two locations that differ by a power of two differ in content, which shows up
+    // an address line that is stuck, open or shorted as aliased data
+    } else if (pattern == PAT_ADDRESS) {
+        printf("(Address in address)\n");
+        for (lp = 0 ; lp < memSize ; lp++) {
+            *bptr++ = (lp & 0xFF) ^ ((lp >> 8) & 0xFF);
+        }
+    // Repeatable pseudo random data (xorshift32) - the seed is reported so a
+    // failing run can be reproduced
+    } else if (pattern == PAT_RANDOM) {
+        printf("(Pseudo random, seed 0x%08x)\n", seed);
+        if (seed == 0) { seed = 1; }            // xorshift never leaves zero
+        for (lp = 0 ; lp < memSize ; lp++) {
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            *bptr++ = seed & 0xFF;
+        }
     // Fills of static value - to detect single cell failures
     } else {                                    // Fill of same value
         printf("(0x%02x)\n",pattern);           
-        for (lp = 0 ; lp <= memSize ; lp++) {
-            *bptr++ = pattern;
+        memset(membuf, pattern, memSize);
+    }
+}
+
+
+// Repeat the first period bytes of the buffer across the rest of it
+// The filled area doubles on each copy, so the pattern is built with a few block moves
+void replicate(char * membuf, int period, int memSize) {
+    int     done = period;
+    int     chunk;
+
+    while (done < memSize) {
+        chunk = (done < memSize - done) ? done : memSize - done;
+        memcpy(membuf + done, membuf, chunk);
+        done += chunk;
+    }
+}
+
+
+// Pick the cheapest set of tests that covers all the requested fault classes
+// There are only a handful of tests, so just try every combination
+int planTest(int faults) {
+    int         set;
+    int         best = -1;
+    int         bestPasses = 0;
+    int         covers;
+    int         passes;
+    unsigned    lp;
+
+    for (set = 1 ; set < (1 << NUMTESTS) ; set++) {
+        covers = 0;
+        passes = 0;
+        for (lp = 0 ; lp < NUMTESTS ; lp++) {
+            if (set & (1 << lp)) {
+                covers |= tests[lp].covers;
+                passes += tests[lp].passes;
+            }
+        }
+        if ((covers & faults) == faults && (best < 0 || passes < bestPasses)) {
+            best = set;
+            bestPasses = passes;
+        }
+    }
+    return (best);
+}
+
+
+// Run the self test for the given coverage level, printing a result for each pattern
+// Returns the number of patterns that failed
+int testDevice(struct eeprom * dev, char * membuf, int memSize, int pageSize, int level, unsigned int seed) {
+    int         plan;
+    int         passes = 0;
+    int         errors[NUMTESTS][2];
+    int         failed = 0;
+    int         pattern;
+    unsigned    lp;
+    int         pat;
+
+    plan = planTest(levelFaults[level]);
+
+    printf("Test level %d plan :\n", level);
+    for (lp = 0 ; lp < NUMTESTS ; lp++) {
+        if (plan & (1 << lp)) {
+            printf("  %s\n", tests[lp].name);
+            passes += tests[lp].passes;
+        }
+    }
+    printf("%d device passes\n\n", passes);
+
+    for (lp = 0 ; lp < NUMTESTS ; lp++) {
+        for (pat = 0 ; pat < 2 ; pat++) {
+            errors[lp][pat] = 0;
+            pattern = tests[lp].patterns[pat];
+            if (!(plan & (1 << lp)) || pattern == PAT_NONE) {
+                continue;
+            }
+            if (pattern == PAT_MARCH) {
+                errors[lp][pat] = marchTest(dev, membuf, memSize, pageSize);
+            } else {
+                fillBuffer(membuf, pattern, memSize, pageSize, seed);
+                writeDevice(dev, membuf, memSize);
+                printf("Verifying.\n");
+                errors[lp][pat] = compareDevice(dev, membuf, memSize);
+                printf(errors[lp][pat] ? "\nVerify failed\n" : "\nVerify OK\n");
+            }
+        }
+    }
+
+    printf("\nTest results\n");
+    for (lp = 0 ; lp < NUMTESTS ; lp++) {
+        if (!(plan & (1 << lp))) {
+            continue;
+        }
+        for (pat = 0 ; pat < 2 ; pat++) {
+            if (tests[lp].patterns[pat] == PAT_NONE) {
+                continue;
+            }
+            printf("  %-24s %d  ", tests[lp].name, pat + 1);
+            if (errors[lp][pat]) {
+                printf("FAIL (%d errors)\n", errors[lp][pat]);
+                failed++;
+            } else {
+                printf("OK\n");
+            }
+        }
+    }
+    printf(failed ? "\nTest failed\n" : "\nTest OK\n");
+    return (failed);
+}
+
+
+// March C- test - {(w0) up(r0,w1) up(r1,w0) down(r0,w1) down(r1,w0) (r0)}
+// The EEPROM is written a page at a time, so each element is applied to a whole
+// page before moving on to the next page in the element's direction
+int marchTest(struct eeprom * dev, char * membuf, int memSize, int pageSize) {
+    static const struct {
+        int     up;                     // Ascending address order
+        int     rd;                     // Value expected, -1 for no read
+        int     wr;                     // Value written, -1 for no write
+    } march[] = {
+        { 1,    -1, 0x00 },
+        { 1,  0x00, 0xFF },
+        { 1,  0xFF, 0x00 },
+        { 0,  0x00, 0xFF },
+        { 0,  0xFF, 0x00 },
+        { 1,  0x00,   -1 },
+    };
+    char        * wbuf;
+    int         element;
+    int         page;
+    int         pages = (memSize + pageSize - 1) / pageSize;  // Including any short last page
+    int         address;
+    int         len;
+    int         errors = 0;
+    int         lp;
+
+    printf("March C-\n");
+    wbuf = membuf + pageSize;           // Page to write, membuf holds the page read back
+
+    for (element = 0 ; element < 6 ; element++) {
+        if (march[element].wr >= 0) {
+            memset(wbuf, march[element].wr, pageSize);
         }
+        for (page = 0 ; page < pages ; page++) {
+            address = (march[element].up ? page : pages - page - 1) * pageSize;
+            len = (memSize - address < pageSize) ? memSize - address : pageSize;
+            if (march[element].rd >= 0) {
+                readFrom(dev, address, membuf, len);
+                for (lp = 0 ; lp < len ; lp++) {
+                    if ((membuf[lp] & 0xFF) != march[element].rd) {
+                        if (++errors <= MAXERRORS) {
+                            printf("March element %d error at 0x%04x read 0x%02x, expect 0x%02x\n",
+                                element, address + lp, membuf[lp] & 0xFF, march[element].rd);
+                        }
+                    }
+                }
+            }
+            if (march[element].wr >= 0) {
+                writeTo(dev, address, wbuf, len);
+            }
+        }
+        putchar('.');
+        fflush(stdout);
     }
+    printf(errors ? "\nMarch C- failed\n" : "\nMarch C- OK\n");
+    return (errors);
 }
 
 
@@ -319,6 +642,7 @@ int hexDump(char * membuf, int size) {
     char        buf[rowlen];
     char        *bptr;
     int         lp;
+    int         count;
 
     bptr = membuf;
 
@@ -326,10 +650,15 @@ int hexDump(char * membuf, int size) {
 
     while (address < size) {
         printf("%04X  ",address);                  // Address start
+        count = (size - address < rowlen) ? size - address : rowlen;   // The last row may be short
 
         for (lp = 0 ; lp< rowlen ; lp++) {
             if (lp == 8) { printf("  "); }
-            printf("%02X ",*bptr);
+            if (lp >= count) {                      // Pad so the characters line up
+                printf("   ");
+                continue;
+            }
+            printf("%02X ",*bptr & 0xFF);
             if (isprint(*bptr)) {
                 buf[lp] = *bptr;
             } else {
@@ -342,7 +671,7 @@ int hexDump(char * membuf, int size) {
         // Print the characters out
         putchar(' ');
         putchar('|');
-        for (lp = 0 ; lp < rowlen ; lp++) {
+        for (lp = 0 ; lp < count ; lp++) {
             if (lp == 8) { printf(" "); }
             if (isprint(buf[lp])) {
                 putchar(buf[lp]);
@@ -400,39 +729,53 @@ void readFileToBuffer(char * membuf, char * filename, int memSize) {
 
 
 // Verify the device to the buffer
-int verifyToBuffer(int fh, char * membuf, int memSize, int pageSize){
+int verifyToBuffer(struct eeprom * dev, char * membuf, int memSize){
+    printf("Verifying.\n");
+    fflush(stdout);
+
+    if (compareDevice(dev, membuf, memSize)) {
+        printf("\nVerify failed\n");
+        exit(23);
+    } else {
+        printf("\nVerify OK\n");
+        return(0);
+    }
+}
+
+// Compare the device with the buffer, returning the number of bytes that differ
+// Only the first few errors are printed, but the whole device is always checked
+int compareDevice(struct eeprom * dev, char * membuf, int memSize){
     int         address=0;              
     char        *vbuf;
     char        *vbp;
     char        *bp;
     int         errors=0;
     int         lp;
+    int         len;
 
     bp=membuf;
 
-	if (!(vbuf= (char *) malloc(pageSize+1))) {         // Create the memory buffer
+	if (!(vbuf= (char *) malloc(dev->ioSize+1))) {      // Create the memory buffer
 		printf("Malloc failed !");
 		exit(2);
 	}
-    vbp = vbuf;
 
-    printf("Verifying.\n");
-    fflush(stdout);
-
-    while ((address < memSize) && (errors < 10)) {
+    while (address < memSize) {
         vbp=vbuf;
+        len = (memSize - address < dev->ioSize) ? memSize - address : dev->ioSize;
 
-        if (readFrom(fh, address, vbp, pageSize)) {               // Read from the memory
+        if (readFrom(dev, address, vbp, len)) {                   // Read from the memory
             printf("Read from device failed\n");
-            return (22);
+            exit(22);
         }
 
-
         // Verify the page
-        for (lp = 0 ; (lp < pageSize) && (errors < 10) ; lp++) {
+        for (lp = 0 ; lp < len ; lp++) {
             if (*vbp != *bp) {
-                printf("Verify error at 0x%04x read 0x%02x, expect 0x%02x\n",address,*vbp, *bp);
-                if (++errors >= 10) {
+                if (++errors <= MAXERRORS) {
+                    printf("Verify error at 0x%04x read 0x%02x, expect 0x%02x\n",address,*vbp & 0xFF, *bp & 0xFF);
+                }
+                if (errors == MAXERRORS) {
                     printf("Ignoring other verify errors\n");
                 }
             } 
@@ -445,19 +788,14 @@ int verifyToBuffer(int fh, char * membuf, int memSize, int pageSize){
         fflush(stdout);
     }
     free(vbuf);
-    if (errors) {
-        printf("\nVerify failed\n");
-        exit(23);
-    } else {
-        printf("\nVerify OK\n");
-        return(0);
-    }
+    return (errors);
 }
 
 // Read the device into the buffer
-void readDevice(int fh, char * membuf, int memSize, int pageSize){
+void readDevice(struct eeprom * dev, char * membuf, int memSize){
     int         address=0;              
     char        *bp;
+    int         len;
 
     bp=membuf;
 
@@ -465,13 +803,14 @@ void readDevice(int fh, char * membuf, int memSize, int pageSize){
     fflush(stdout);
 
     while (address < memSize) {
-        if (readFrom(fh, address, bp, pageSize)) {               // Read from the memory
+        len = (memSize - address < dev->ioSize) ? memSize - address : dev->ioSize;
+        if (readFrom(dev, address, bp, len)) {                   // Read from the memory
             printf("Read from device failed\n");
             exit(22);
         }
 
-        address+=pageSize;
-        bp+=pageSize;
+        address+=len;
+        bp+=len;
         putchar('.');
         fflush(stdout);
     }
@@ -479,214 +818,24 @@ void readDevice(int fh, char * membuf, int memSize, int pageSize){
 }
 
 // Write the device from the buffer
-void writeDevice(int fh, char * membuf, int memSize, int pageSize){
-    int         address=0;               
-    char        *bp;
-    bp=membuf;
+// This runs as an asynchronous job, so the write cycles are timed rather than busy polled
+void writeDevice(struct eeprom * dev, char * membuf, int memSize){
+    struct eepromJob    job;
 
     printf("Writing device.\n");
     fflush(stdout);
 
-    while (address < memSize) {
-        writeTo(fh, address, bp, pageSize);
-        address+=pageSize;
-        bp+=pageSize;
-        putchar('.');
-        fflush(stdout);
+    if (jobStart(&job, dev, 1, 0, membuf, memSize, dev->ioSize, NULL, NULL)) {
+        printf("Unable to start the write\n");
+        exit(2);
     }
-    printf("\nDone\n");
-}
-
-
-// Open the connection to the device
-int openDevice(int bus, int device, int pageSize, int sizek) {
-    char    filename[20];
-    int     fh;
-
-    printf("Opening device 0x%02x on bus %x...\n",device,bus);
-    printf("Device is %dK with page size of %d bytes\n",sizek, pageSize);
-    printf("\n");
-    sprintf(filename,"/dev/i2c-%d",bus);		// Includes the I2C bus that the device is on
-    if ((fh = open(filename,O_RDWR)) < 0) {
-        printf("Failed to open the bus.\n");
-        /* ERROR HANDLING; you can check errno to see what went wrong */
-        exit(20);
+    if (runJob(&job)) {
+        printf("\nHard write error - aborting\n");
+        exit(21);
     }
-
-    if (ioctl(fh, I2C_SLAVE, device) < 0) {
-        printf("Failed to acquire bus access and/or talk to slave.\n");
-        /* ERROR HANDLING; you can check errno to see what went wrong */
-        exit(20);
-    }
-    return (fh);
-}
-
-// Go to the specified address in the chip
-int gotoAddress(int fh, int address) {
-	char			buf[5];
-	int				ret;
-
-#ifdef DEBUGGING
-    const char *	buffer;
-#endif
-
-    buf[0] = (address & 0xFF00) >> 8;
-    buf[1] = address & 0xFF;
-
-    pollReady(fh);                          // Wait until the chip is ready to do another operation
-    if ((ret = write(fh, buf, 2)) != 2) {   // ERROR HANDLING: i2c transaction failed 
-        #ifdef DEBUGGING
-            printf("Failed to set the EEPROM address.\n");
-            buffer = strerror(errno);
-            printf(buffer);
-            printf("\n\n");
-        #endif
-		return (1);
-    }
-	return (0);
-}
-
-
-// Write the specified buffer at the specified offset
-// Ensure that we do not exceed the maximum page size of the device
-// Since the I2C bus is a shared resource, we may fail to read if another device is 
-// doing someething (including talking to our chip !)
-int writeTo(int fh, int address, char * buf, int pageSize) {
-    char            * bp;
-	char            * ptr;
-	int		        toWrite = pageSize;
-    int             thisWrite;
-    int             retries=0;
-    int             success=0;
-
-#ifdef DEBUGGING
-    const char *	buffer;
-#endif
-
-	if (!(bp= (char *) malloc(pageSize+3))) {       // Biggest thing we can write is a page - plus an address
-		printf("Malloc failed !");
-		exit(2);
-	}
-
-//    printf("Write at address 0x%04x for 0x%04x bytes\n",address, iolen);
-
-	while (toWrite >0) {                        // Still data to write
-        pollReady(fh);                          // Wait until the chip is ready to do another operation
-        thisWrite= 0;                           // an empty page
-        ptr = bp;                               // Prepare the next page of data
-        *ptr++ = (address & 0xFF00) >> 8;		// Move to the specified address
-        *ptr++ = address & 0xFF;
-    
-        while (toWrite >0 && (thisWrite < pageSize)) {  // Fill the buffer
-            *ptr++ = *buf++;
-            thisWrite++;
-            toWrite--;
-        }
-        thisWrite+=2;                           // Add on the address to the size
-        success=0;
-        retries=0;
-        while (!success && retries < 100) {
-            if (write(fh, bp, thisWrite) != thisWrite) {        // Try to write the data
-                #ifdef DEBUGGING
-                    printf("Failed to write to i2c bus.\n");    
-                    buffer = strerror(errno);
-                    printf(buffer);
-                    printf("\n\n");
-                #else
-                    putchar('E');               // Indicate error on output
-                    fflush(stdout);
-                #endif
-                usleep(10);	                    // 10us delay
-                retries++;
-
-            } else {
-                success=1;
-            }
-        }
-
-        if (!success) {
-            printf("\nHard write error - aborting\n");
-            exit (21);
-        }
-
-        thisWrite-=2;               // Remove the address offset from the buffer again
-        address += thisWrite;       // Update the address of the next write
-	}
-    pollReady(fh);              // Wait until the chip is ready to do another operation
-	free (bp);
-    return (success);
-}
-
-// Read from the specified device into the provided buffer
-// It seems that the I2C driver subsystem or devices can't handle read beyond 1K,
-// so use smaller reads ..
-// Since the I2C bus is a shared resource, we may fail to read if another device is 
-// doing someething (including talking to our chip !)
-
-int	readFrom(int fh, int address, char * buf, int iolen) {
-    int             bytesRead;
-    int             retries=0;
-    int             success=0;
-
-#ifdef DEBUGGING
-    const char *	buffer;
-#endif
-
-    if (iolen >1024) {
-        printf("Maximum IO length is 1K. use a smaller read\n");
-        return (-1);
-    }
-
-    pollReady(fh);                                                  // Wait until the chip is ready to do another operation
-    while (!success && retries++ <100) {
-        if (gotoAddress(fh,address)) {
-            #ifdef DEBUGGING
-                printf("Failed to goto address 0x%04x\n",address);
-            #else
-                putchar('E');                                       // Indicate error on output
-                fflush(stdout);
-            #endif
-            usleep(10);	                                            // 10us delay
-        } else {
-            if ((bytesRead = read(fh, buf, iolen)) != iolen) {      // I2C Read
-                #ifdef DEBUGGING
-                    printf("Failed to read from the i2c bus.\n");   // ERROR HANDLING: i2c transaction failed 
-                    buffer = strerror(errno);
-                    printf(buffer);
-                    printf("\n\n");
-                #else
-                    putchar('E');                                   // Indicate error on output
-                    fflush(stdout);
-                #endif
-                usleep(10);	                                        // 01us delay
-            } else {
-                success=1;
-            }
-        }
-    }     
-    if (!success) {
-        printf("\nHard read error - aborting\n");
-        exit (22);
-    }
-    return (0);
+    printf("\nDone\n");
 }
 
-// Poll for the device being ready. This is done by performing a single byte read
-// the device will fail to acknowledge whilst it is still busy writing
-
-int pollReady(int fh) {
-	char            buf[2];
-    int             timeout=100;
-
-    // Poll for the device coming ready after a write - reads cant be performed whilst a write is occurring
-    while (read(fh,buf,1) != 1) {
-        usleep(1);	                                        // 1us delay
-        if (timeout-- == 0) {
-            return (1);                                     // If its taken this long then the chip is dead
-        }
-    }
-    return (0);
-}
 
 // Print instructions for the user
 void usage() {
@@ -695,13 +844,33 @@ void usage() {
 	printf("Options:\n"
 	       "  -h                Print this help.\n"
 	       "  -p <page-size>    Page size of device. default is 32 bytes.\n"
-	       "  -s <dev-size>     Set the device size in Kb. 1-64 Kb.\n"
+	       "  -s <dev-size>     Set the device size in Kb. 1-64 Kb. default is 4 Kb on the bus.\n"
 	       "  -f <pattern>      Fill device with specified pattern.\n"
 	       "        0 - All zero's (0x00).\n"
 	       "        1 - All one's  (0xFF).\n"
 	       "        3 - Incremental pattern with +3 offset on each page (0x100)\n"
 	       "        c - Checkerboard\n"
 	       "        d - Inverse Checkerboard.\n"
+	       "        w - Walking one's.\n"
+	       "        z - Walking zero's.\n"
+	       "        a - Address in address.\n"
+	       "        r - Pseudo random (see -e).\n"
+	       "  -t <level>        Self test, runs the fewest patterns needed to detect\n"
+	       "        1 - Stuck cells.\n"
+	       "        2 - + Address decoder faults.\n"
+	       "        3 - + Data line faults.\n"
+	       "        4 - + Transition and coupling faults (March C-).\n"
+	       "        5 - + Pattern sensitive faults.\n"
+	       "  -e <seed>         Seed for the pseudo random pattern. default is 1.\n"
+	       "  -m <method>       Transfer method. default is the best the adapter supports.\n"
+	       "        a - Automatic.\n"
+	       "        i - I2C_RDWR combined transfers.\n"
+	       "        r - Plain read / write.\n"
+	       "        b - SMBus I2C block writes, byte reads.\n"
+	       "        s - SMBus byte at a time.\n"
+	       "        k - Kernel driver's sysfs eeprom file for the bus and address.\n"
+	       "  -k <file>         Use a kernel eeprom (at24 / nvmem) or plain file, not the bus.\n"
+	       "                    The device size is taken from the file unless -s is given.\n"
 	       "  -d                Dump (read) device and hex dump to stdout.\n"
 	       "  -w                Write file contents into EEPROM.\n"
 	       "  -r                Read contents of EEPROM into file.\n"